@@ -0,0 +1,92 @@
+// Animation frame deltas
+//
+// Each frame after the first is stored as spans of bitplane words that changed
+// from the previous frame, in the same layout as the full bitplane data. All
+// values are big-endian:
+//
+//   u32 number of spans
+//   per span:
+//     u32 word offset
+//     u16 word count
+//     words
+
+#include <string.h>
+
+#include "anim.h"
+#include "byte_order.h"
+
+#define MAX_SPAN_WORDS 0xffff
+// Unchanged words to bridge rather than starting a new span, as a span header
+// costs the same as three words
+#define SPAN_GAP 3
+
+static inline int word_changed(const unsigned char *prev,
+                               const unsigned char *next, int word) {
+  return prev[word * 2] != next[word * 2] ||
+         prev[word * 2 + 1] != next[word * 2 + 1];
+}
+
+// Largest possible delta: spans of one changed word separated by a gap
+size_t delta_bound(int bpl_size) {
+  int words = bpl_size / 2;
+  return 4 + bpl_size + 6 * (words / (SPAN_GAP + 1) + 1);
+}
+
+// Encode changes from `prev` to `next`, returning delta size
+size_t encode_delta(const unsigned char *prev, const unsigned char *next,
+                    int bpl_size, unsigned char *delta) {
+  int words = bpl_size / 2;
+  unsigned int num_spans = 0;
+  unsigned char *out = delta + 4;
+
+  int i = 0;
+  while (i < words) {
+    if (!word_changed(prev, next, i)) {
+      i++;
+      continue;
+    }
+    // Extend span to the last changed word before a large enough gap
+    int start = i;
+    int end = i + 1;
+    for (int j = end; j < words && j - start < MAX_SPAN_WORDS; j++) {
+      if (word_changed(prev, next, j))
+        end = j + 1;
+      else if (j - end + 1 >= SPAN_GAP)
+        break;
+    }
+
+    int count = end - start;
+    put_u32(out, start);
+    out[4] = count >> 8;
+    out[5] = count;
+    memcpy(out + 6, next + start * 2, count * 2);
+    out += 6 + count * 2;
+    num_spans++;
+    i = end;
+  }
+
+  put_u32(delta, num_spans);
+  return out - delta;
+}
+
+// Reference decoder: apply a delta to the previous frame's bitplane data.
+// Returns 0 if the delta is malformed.
+int apply_delta(const unsigned char *delta, size_t len,
+                unsigned char *bpl_data, int bpl_size) {
+  if (len < 4)
+    return 0;
+  unsigned int num_spans = get_u32(delta);
+  size_t pos = 4;
+  for (unsigned int s = 0; s < num_spans; s++) {
+    if (pos + 6 > len)
+      return 0;
+    size_t offset = (size_t)get_u32(delta + pos) * 2;
+    size_t count = ((delta[pos + 4] << 8) | delta[pos + 5]) * 2;
+    pos += 6;
+    if (pos + count > len || offset + count > (size_t)bpl_size)
+      return 0;
+    memcpy(bpl_data + offset, delta + pos, count);
+    pos += count;
+  }
+  return pos == len;
+}
@@ -0,0 +1,9 @@
+#include <stddef.h>
+
+size_t delta_bound(int bpl_size);
+
+size_t encode_delta(const unsigned char *prev, const unsigned char *next,
+                    int bpl_size, unsigned char *delta);
+
+int apply_delta(const unsigned char *delta, size_t len,
+                unsigned char *bpl_data, int bpl_size);
@@ -4,11 +4,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
+#include "anim.h"
+#include "byte_order.h"
 #include "image.h"
 #include "log.h"
+#include "pack.h"
+#include "parallel.h"
 #include "safe_mem.h"
 
+// Packed output settings
+static int pack = 0;           // Pack output files
+static int pack_chunk_size = 0; // Bitplane bytes per packed chunk (0 = single)
+static int pack_jobs = 0;      // Threads to pack / convert with (0 = one per CPU)
+
+// Tile mode settings
+static int tile_width = 0; // Emit each tile's bitplanes contiguously (0 = off)
+static int tile_height = 0;
+
 uint16_t convert12bit(png_color col) {
   unsigned int r = col.red >> 4; // Convert 8-bit to 4-bit
   unsigned int g = col.green >> 4;
@@ -18,37 +32,52 @@ uint16_t convert12bit(png_color col) {
 
 uint16_t swap16(uint16_t val) { return (val >> 8) | (val << 8); }
 
-void export_palette_raw(const Image *image, const char *filename) {
+// Write output file, packing it if enabled
+void write_output(const char *filename, const unsigned char *data, size_t size,
+                  size_t chunk_size) {
+  if (pack) {
+    write_packed(filename, data, size, chunk_size,
+                 pack_jobs > 0 ? pack_jobs : default_jobs());
+    return;
+  }
   FILE *fp = fopen(filename, "wb");
   if (!fp) {
     error_log("Error: Could not open %s for writing.\n", filename);
     return;
   }
+  fwrite(data, 1, size, fp);
+  fclose(fp);
+}
+
+void export_palette_raw(const Image *image, const char *filename) {
   uint16_t *palette = safe_malloc(image->num_colors * 2);
   for (int i = 0; i < image->num_colors; i++) {
     unsigned char k = image->palette_order[i];
     palette[k] = swap16(convert12bit(image->palette[i]));
   }
-  fwrite(palette, 2, image->num_colors, fp);
+  write_output(filename, (unsigned char *)palette, image->num_colors * 2, 0);
   free(palette);
-  fclose(fp);
 }
 
 void export_palette_copper(const Image *image, const char *filename) {
-  FILE *fp = fopen(filename, "wb");
-  if (!fp) {
-    error_log("Error: Could not open %s for writing.\n", filename);
-    return;
-  }
   uint16_t *palette = safe_malloc(image->num_colors * 4);
   for (int i = 0; i < image->num_colors; i++) {
     unsigned char k = image->palette_order[i];
     palette[k * 2] = swap16(0x180 + k * 2);
     palette[k * 2 + 1] = swap16(convert12bit(image->palette[i]));
   }
-  fwrite(palette, 4, image->num_colors, fp);
+  write_output(filename, (unsigned char *)palette, image->num_colors * 4, 0);
   free(palette);
-  fclose(fp);
+}
+
+// Convert in the selected layout
+void convert_bitplanes(const Image *image, unsigned char *bpl_data,
+                       int interleaved) {
+  if (tile_width) {
+    c2p_tiles(image, tile_width, tile_height, bpl_data, interleaved);
+  } else {
+    c2p(image, bpl_data, interleaved);
+  }
 }
 
 void export_bitplane_data(const Image *image, const char *output_file,
@@ -57,26 +86,198 @@ void export_bitplane_data(const Image *image, const char *output_file,
   unsigned char *bpl_data = safe_malloc(bpl_size);
 
   verbose_log("Interleaved mode: %s\n", interleaved ? "ON" : "OFF");
-  c2p(image, bpl_data, interleaved);
+  if (tile_width)
+    verbose_log("Tile mode: %d x %d\n", tile_width, tile_height);
+  convert_bitplanes(image, bpl_data, interleaved);
 
-  FILE *fpout = fopen(output_file, "wb");
-  if (!fpout) {
-    error_log("Could not open file %s for writing\n", output_file);
-    free(bpl_data);
-    return;
+  // Keep packed chunks to whole rows, or whole tiles in tile mode
+  int chunk_size = 0;
+  if (pack_chunk_size > 0) {
+    int unit = image->width / 8;
+    if (tile_width)
+      unit = (tile_width / 8) * tile_height * image->bitplanes;
+    else if (interleaved)
+      unit *= image->bitplanes;
+    chunk_size = pack_chunk_size / unit * unit;
+    if (chunk_size < unit)
+      chunk_size = unit;
   }
 
-  fwrite(bpl_data, 1, bpl_size, fpout);
-  fclose(fpout);
+  write_output(output_file, bpl_data, bpl_size, chunk_size);
   free(bpl_data);
 }
 
+typedef struct {
+  const Image *first;
+  char **frame_files;
+  int interleaved;
+  int bpl_size;
+  unsigned char **frames;
+  unsigned char **deltas;
+  size_t *delta_sizes;
+  char *frame_ok; // Set per frame by its worker, checked once all are done
+} Animation;
+
+static int same_palette(const Image *a, const Image *b) {
+  if (a->num_colors != b->num_colors)
+    return 0;
+  for (int i = 0; i < a->num_colors; i++) {
+    if (a->palette[i].red != b->palette[i].red ||
+        a->palette[i].green != b->palette[i].green ||
+        a->palette[i].blue != b->palette[i].blue)
+      return 0;
+  }
+  return 1;
+}
+
+// Load and convert a frame after the first, which must match its dimensions
+// and palette
+static void convert_frame(int index, void *arg) {
+  Animation *anim = arg;
+  const char *filename = anim->frame_files[index + 1];
+  Image frame = read_png_indexed((char *)filename);
+  if (!frame.success) {
+    error_log("Error reading PNG data: %s\n", filename);
+    return;
+  }
+  if (frame.width != anim->first->width ||
+      frame.height != anim->first->height ||
+      !same_palette(&frame, anim->first)) {
+    error_log("Error: Frame %s doesn't match size or palette of first frame\n",
+              filename);
+  } else {
+    anim->frames[index + 1] = safe_malloc(anim->bpl_size);
+    convert_bitplanes(&frame, anim->frames[index + 1], anim->interleaved);
+    anim->frame_ok[index + 1] = 1;
+  }
+  free_image(&frame);
+}
+
+static void encode_frame(int index, void *arg) {
+  Animation *anim = arg;
+  anim->deltas[index + 1] = safe_malloc(delta_bound(anim->bpl_size));
+  anim->delta_sizes[index + 1] =
+      encode_delta(anim->frames[index], anim->frames[index + 1],
+                   anim->bpl_size, anim->deltas[index + 1]);
+}
+
+// Encode deltas, check them with the reference decoder, then write the
+// animation stream:
+//
+//   "BPLA"
+//   u16 width, height, bitplanes
+//   u16 flags (bit 0: interleaved)
+//   u16 tile width, height (0 if not tiled)
+//   u32 number of frames
+//   first frame bitplane data
+//   per subsequent frame:
+//     u32 delta size
+//     delta (see anim.c)
+static int write_animation(Animation *anim, int num_frames,
+                           const char *output_file, int jobs) {
+  parallel_for(num_frames - 1, jobs, encode_frame, anim);
+
+  // Check reconstruction with the reference decoder
+  unsigned char *decoded = safe_malloc(anim->bpl_size);
+  memcpy(decoded, anim->frames[0], anim->bpl_size);
+  for (int f = 1; f < num_frames; f++) {
+    if (!apply_delta(anim->deltas[f], anim->delta_sizes[f], decoded,
+                     anim->bpl_size) ||
+        memcmp(decoded, anim->frames[f], anim->bpl_size)) {
+      error_log("Error: Delta for frame %d doesn't reconstruct\n", f + 1);
+      free(decoded);
+      return 0;
+    }
+  }
+  free(decoded);
+
+  size_t size = 20 + anim->bpl_size;
+  for (int f = 1; f < num_frames; f++) {
+    size += 4 + anim->delta_sizes[f];
+  }
+  unsigned char *stream = safe_malloc(size);
+  memcpy(stream, "BPLA", 4);
+  put_u16(stream + 4, anim->first->width);
+  put_u16(stream + 6, anim->first->height);
+  put_u16(stream + 8, anim->first->bitplanes);
+  put_u16(stream + 10, anim->interleaved);
+  put_u16(stream + 12, tile_width);
+  put_u16(stream + 14, tile_height);
+  put_u32(stream + 16, num_frames);
+  memcpy(stream + 20, anim->frames[0], anim->bpl_size);
+  unsigned char *out = stream + 20 + anim->bpl_size;
+  for (int f = 1; f < num_frames; f++) {
+    verbose_log("Frame %d: %zu bytes\n", f + 1, anim->delta_sizes[f]);
+    put_u32(out, anim->delta_sizes[f]);
+    memcpy(out + 4, anim->deltas[f], anim->delta_sizes[f]);
+    out += 4 + anim->delta_sizes[f];
+  }
+
+  size_t full_size = (size_t)anim->bpl_size * num_frames;
+  printf("%d frames: %zu bytes delta vs %zu bytes full (%.1f%%)\n",
+         num_frames, size, full_size, 100.0 * size / full_size);
+
+  write_output(output_file, stream, size, pack_chunk_size);
+  free(stream);
+  return 1;
+}
+
+// Export a frame sequence as full bitplanes for the first frame, followed by
+// deltas from each previous frame. Frames are converted in parallel.
+int export_animation(const Image *first, char **frame_files, int num_frames,
+                     const char *output_file, int interleaved) {
+  int jobs = pack_jobs > 0 ? pack_jobs : default_jobs();
+  Animation anim = {0};
+  anim.first = first;
+  anim.frame_files = frame_files;
+  anim.interleaved = interleaved;
+  anim.bpl_size = (first->width / 8) * first->height * first->bitplanes;
+  anim.frames = safe_calloc(num_frames, sizeof(unsigned char *));
+  anim.deltas = safe_calloc(num_frames, sizeof(unsigned char *));
+  anim.delta_sizes = safe_calloc(num_frames, sizeof(size_t));
+  anim.frame_ok = safe_calloc(num_frames, 1);
+
+  verbose_log("Interleaved mode: %s\n", interleaved ? "ON" : "OFF");
+  anim.frames[0] = safe_malloc(anim.bpl_size);
+  convert_bitplanes(first, anim.frames[0], interleaved);
+  parallel_for(num_frames - 1, jobs, convert_frame, &anim);
+
+  int success = 1;
+  for (int f = 1; f < num_frames; f++) {
+    success &= anim.frame_ok[f];
+  }
+  success = success && write_animation(&anim, num_frames, output_file, jobs);
+
+  for (int f = 0; f < num_frames; f++) {
+    free(anim.frames[f]);
+    free(anim.deltas[f]);
+  }
+  free(anim.frames);
+  free(anim.deltas);
+  free(anim.delta_sizes);
+  free(anim.frame_ok);
+  return success;
+}
+
 void print_usage(const char *prog_name) {
   printf("Usage: %s [options] <image.png> <output_file>\n", prog_name);
+  printf("       %s [options] --anim <frame.png>... <output_file>\n",
+         prog_name);
   printf("Options:\n");
   printf("  -i, --interleaved          Enable interleaved mode\n");
+  printf("  -u, --remove-unused        Remove unused colors from palette\n");
+  printf("  -d, --merge-duplicates     Merge colors with identical RGB values\n");
   printf("  -r, --raw-palette=FILE     Export raw palette\n");
   printf("  -c, --copper-palette=FILE  Export palette as copper list\n");
+  printf("  -T, --tile=WxH             Emit bitplanes for each tile "
+         "contiguously\n");
+  printf("  -a, --anim                 Convert frame sequence to delta "
+         "encoded animation\n");
+  printf("  -p, --pack                 Pack output files with zlib\n");
+  printf("  -C, --chunk-size=BYTES     Bitplane bytes per packed chunk "
+         "[default: single chunk]\n");
+  printf("  -j, --jobs=N               Chunks / frames to process in parallel "
+         "[default: one per CPU]\n");
   printf("  -v, --verbose              Enable verbose output\n");
   printf("  -h, --help                 Display this help message\n");
 }
@@ -85,18 +286,28 @@ int main(int argc, char *argv[]) {
   int interleaved = 0;
   char *raw_palette_file = NULL;
   char *copper_palette_file = NULL;
+  int remove_unused = 0;
+  int merge_duplicates = 0;
+  int anim = 0;
   int opt;
 
   // Define long options
   static struct option long_options[] = {
       {"interleaved", no_argument, 0, 'i'},
       {"verbose", no_argument, 0, 'v'},
+      {"remove-unused", no_argument, 0, 'u'},
+      {"merge-duplicates", no_argument, 0, 'd'},
       {"raw-palette", required_argument, 0, 'r'},
       {"copper-palette", required_argument, 0, 'c'},
+      {"tile", required_argument, 0, 'T'},
+      {"anim", no_argument, 0, 'a'},
+      {"pack", no_argument, 0, 'p'},
+      {"chunk-size", required_argument, 0, 'C'},
+      {"jobs", required_argument, 0, 'j'},
       {"help", no_argument, 0, 'h'},
       {0, 0, 0, 0}};
 
-  while ((opt = getopt_long(argc, argv, "ivr:c:h", long_options, NULL)) != -1) {
+  while ((opt = getopt_long(argc, argv, "ivudr:c:T:apC:j:h", long_options, NULL)) != -1) {
     switch (opt) {
     case 'i':
       interleaved = 1;
@@ -104,12 +315,36 @@ int main(int argc, char *argv[]) {
     case 'v':
       verbose = 1;
       break;
+    case 'u':
+      remove_unused = 1;
+      break;
+    case 'd':
+      merge_duplicates = 1;
+      break;
     case 'r':
       raw_palette_file = optarg;
       break;
     case 'c':
       copper_palette_file = optarg;
       break;
+    case 'T':
+      if (sscanf(optarg, "%dx%d", &tile_width, &tile_height) != 2) {
+        error_log("Error: Tile size must be WxH\n");
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'a':
+      anim = 1;
+      break;
+    case 'p':
+      pack = 1;
+      break;
+    case 'C':
+      pack_chunk_size = atoi(optarg);
+      break;
+    case 'j':
+      pack_jobs = atoi(optarg);
+      break;
     case 'h':
       print_usage(argv[0]);
       return EXIT_SUCCESS;
@@ -119,15 +354,22 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  // Ensure we have at least two positional arguments: input and output file
-  if (optind + 2 != argc) {
+  // Ensure we have at least two positional arguments: input and output file.
+  // In animation mode all but the last are input frames.
+  if (anim ? optind + 2 > argc : optind + 2 != argc) {
     error_log("Error: Incorrect number of arguments.\n");
     print_usage(argv[0]);
     return EXIT_FAILURE;
   }
 
   char *input_file = argv[optind];
-  char *output_file = argv[optind + 1];
+  char *output_file = argv[argc - 1];
+  int num_frames = argc - 1 - optind;
+
+  if (anim && (remove_unused || merge_duplicates)) {
+    error_log("Error: Palette compaction can't be used in animation mode\n");
+    return EXIT_FAILURE;
+  }
 
   Image image = read_png_indexed(input_file);
   if (!image.success) {
@@ -137,6 +379,21 @@ int main(int argc, char *argv[]) {
   verbose_log("%d x %d, %d colors\n", image.width, image.height,
               image.num_colors);
 
+  if (remove_unused || merge_duplicates) {
+    int old_colors = image.num_colors;
+    int old_bitplanes = image.bitplanes;
+    int *remap = safe_malloc(old_colors * sizeof(int));
+    compact_palette(&image, remove_unused, merge_duplicates, remap);
+    free(remap);
+    verbose_log("Compacted palette: %d -> %d colors, %d -> %d bitplanes\n",
+                old_colors, image.num_colors, old_bitplanes, image.bitplanes);
+  }
+
+  if (tile_width && !check_tile_size(&image, tile_width, tile_height)) {
+    free_image(&image);
+    return EXIT_FAILURE;
+  }
+
   // Export Palette if requested
   if (raw_palette_file) {
     verbose_log("Raw palette export: %s\n", raw_palette_file);
@@ -147,6 +404,17 @@ int main(int argc, char *argv[]) {
     export_palette_copper(&image, copper_palette_file);
   }
 
+  if (anim) {
+    verbose_log("Animation export: %s\n", output_file);
+    int success = export_animation(&image, &argv[optind], num_frames,
+                                   output_file, interleaved);
+    free_image(&image);
+    if (!success)
+      return EXIT_FAILURE;
+    verbose_log("Conversion complete!\n");
+    return EXIT_SUCCESS;
+  }
+
   // Export bitplane data
   verbose_log("Bitplane data export: %s\n", output_file);
   export_bitplane_data(&image, output_file, interleaved);
@@ -10,9 +10,13 @@
 #include <zlib.h>
 #include <stdint.h>
 
+#include "byte_order.h"
+#include "dist.h"
 #include "image.h"
 #include "log.h"
+#include "parallel.h"
 #include "safe_mem.h"
+#include "tiles.h"
 
 // Simulated-annealing settings
 float sa_start_temp = 1000.0; // Starting temperature
@@ -20,9 +24,68 @@ float sa_cooling = 0.99;      // Cooling multiplier (0.99 means slow cooling)
 float sa_min_temp = 0.1;      // Stop when temperature is very low
 int sa_iterations = 20;       // Number of swaps per temperature step
 
+// Coarse-to-fine settings
+int sample_budget = 0; // Bitplane bytes to sample in coarse pass (0 = off)
+int sample_keep = 3;   // Number of coarse orderings to refine on full image
+#define SAMPLE_BAND_ROWS 16 // Scanlines per sampled band
+
+// Distributed settings
+int min_workers = 1; // Workers to wait for before starting
+int num_chains = 0;  // Independent SA chains (0 = one per worker)
+#define DIST_BATCH 16 // Orderings per scoring job
+
+// Fused evaluation settings
+int fused_mode = 0; // Always use fused evaluation
+#define FUSED_MIN_SIZE (256 * 1024) // Bitplane size to use fused evaluation from
+#define FUSED_BAND_BYTES (16 * 1024) // Bitplane bytes converted per band
+
 static int *locked_map = NULL;
+static int *unused_map = NULL;
 static int ehb_mode = 0;
 
+// Best distinct orderings seen during the coarse pass
+typedef struct {
+  int count;
+  int max;
+  int num_colors;
+  unsigned char **orders;
+  uLongf *sizes;
+} Candidates;
+
+// Sampled subset of scanline bands, sharing palette order with the full image
+typedef struct {
+  Image image;
+  int bands;
+  int bpl_size;
+  unsigned char *bpl_data;
+  unsigned char *compressed_data;
+} Sample;
+
+// Running sums for sampled vs full size correlation
+typedef struct {
+  int n;
+  double sx, sy, sxx, syy, sxy;
+} Correlation;
+
+// Fused c2p and compression, feeding bands of converted rows straight to a
+// deflate stream so the working set stays constant regardless of image height
+typedef struct {
+  int ready;
+  z_stream strm;
+  unsigned char *band;
+  int band_size;
+  unsigned char out[FUSED_BAND_BYTES];
+} FusedStream;
+
+static FusedStream fused = {0};
+static TileSet *tile_set = NULL; // Score as sum of per-tile sizes when set
+// Extra work done alongside each evaluation in the coarse-to-fine search
+typedef struct {
+  Candidates *candidates;   // Track best distinct orderings when set
+  Sample *pair_sample;      // Also score this sample when set
+  Correlation *correlation; // Sampled vs full sizes of paired evaluations
+} SearchContext;
+
 void parse_locked_indexes(char *arg, int num_colors) {
   char *token = strtok(arg, ",");
   locked_map = safe_calloc(num_colors, sizeof(int));
@@ -42,6 +105,46 @@ static inline int is_locked(int index) {
   return locked_map && locked_map[index];
 }
 
+// Mark palette entries no pixel uses. In EHB mode an entry only counts as
+// unused if its half-brite pair is too.
+void find_unused_colors(const Image *image) {
+  int *counts = safe_malloc(image->num_colors * sizeof(int));
+  color_histogram(image, counts);
+  free(unused_map);
+  unused_map = safe_calloc(image->num_colors, sizeof(int));
+  int used = 0;
+  for (int i = 0; i < image->num_colors; i++) {
+    unused_map[i] = !counts[i];
+    used += counts[i] > 0;
+  }
+  if (ehb_mode) {
+    for (int i = 0; i < 32; i++) {
+      unused_map[i] = unused_map[i] && unused_map[i + 32];
+    }
+  }
+  verbose_log("%d of %d colors used\n", used, image->num_colors);
+  free(counts);
+}
+
+// Swapping two unused entries can't change the bitplane data, so there's no
+// need to evaluate it
+static inline int is_free_pair(int i, int j) {
+  return unused_map && unused_map[i] && unused_map[j];
+}
+
+// Check whether any swap is worth evaluating
+static int has_swaps(int max_color) {
+  for (int i = 0; i < max_color; i++) {
+    if (is_locked(i))
+      continue;
+    for (int j = i + 1; j < max_color; j++) {
+      if (!is_locked(j) && !is_free_pair(i, j))
+        return 1;
+    }
+  }
+  return 0;
+}
+
 // Swap palette entries; in EHB mode also swap the corresponding half-brite pair
 static inline void swap_palette(unsigned char *palette_order, int i, int j) {
   unsigned char tmp = palette_order[i];
@@ -54,6 +157,140 @@ static inline void swap_palette(unsigned char *palette_order, int i, int j) {
   }
 }
 
+// Keep ordering if it's among the best distinct ones seen so far
+static void track_candidate(Candidates *candidates, const unsigned char *order,
+                            uLongf size) {
+  int worst = 0;
+  for (int k = 0; k < candidates->count; k++) {
+    if (!memcmp(candidates->orders[k], order, candidates->num_colors))
+      return;
+    if (candidates->sizes[k] > candidates->sizes[worst])
+      worst = k;
+  }
+  if (candidates->count < candidates->max) {
+    worst = candidates->count++;
+  } else if (size >= candidates->sizes[worst]) {
+    return;
+  }
+  memcpy(candidates->orders[worst], order, candidates->num_colors);
+  candidates->sizes[worst] = size;
+}
+
+static void add_correlation_pair(Correlation *correlation, double x,
+                                 double y) {
+  correlation->n++;
+  correlation->sx += x;
+  correlation->sy += y;
+  correlation->sxx += x * x;
+  correlation->syy += y * y;
+  correlation->sxy += x * y;
+}
+
+// Pearson correlation coefficient of recorded pairs
+static double correlation_coefficient(const Correlation *correlation) {
+  double n = correlation->n;
+  double cov = n * correlation->sxy - correlation->sx * correlation->sy;
+  double vx = n * correlation->sxx - correlation->sx * correlation->sx;
+  double vy = n * correlation->syy - correlation->sy * correlation->sy;
+  if (vx <= 0 || vy <= 0)
+    return 0;
+  return cov / sqrt(vx * vy);
+}
+
+static void fused_deflate(unsigned char *data, int len, int flush) {
+  z_stream *strm = &fused.strm;
+  strm->next_in = data;
+  strm->avail_in = len;
+  // Only the compressed size is needed, so output is discarded
+  do {
+    strm->next_out = fused.out;
+    strm->avail_out = sizeof(fused.out);
+    deflate(strm, flush);
+  } while (strm->avail_out == 0);
+}
+
+static uLongf compress_bitplanes_fused(Image *image, int interleaved) {
+  z_stream *strm = &fused.strm;
+  if (!fused.ready) {
+    memset(strm, 0, sizeof(*strm));
+    deflateInit(strm, Z_DEFAULT_COMPRESSION);
+    fused.ready = 1;
+  } else {
+    deflateReset(strm);
+  }
+
+  // Bands are whole rows in output order: all planes per row when interleaved,
+  // otherwise each plane region in turn
+  int row_bytes = image->width / 8;
+  if (interleaved)
+    row_bytes *= image->bitplanes;
+  int band_rows = FUSED_BAND_BYTES / row_bytes;
+  if (band_rows < 1)
+    band_rows = 1;
+  if (fused.band_size < band_rows * row_bytes) {
+    fused.band_size = band_rows * row_bytes;
+    fused.band = safe_realloc(fused.band, fused.band_size);
+  }
+
+  int passes = interleaved ? 1 : image->bitplanes;
+  for (int p = 0; p < passes; p++) {
+    for (int y = 0; y < image->height; y += band_rows) {
+      int rows = image->height - y < band_rows ? image->height - y : band_rows;
+      if (interleaved) {
+        c2p_rows(image, y, rows, fused.band);
+      } else {
+        c2p_plane_rows(image, p, y, rows, fused.band);
+      }
+      fused_deflate(fused.band, rows * row_bytes, Z_NO_FLUSH);
+    }
+  }
+  fused_deflate(NULL, 0, Z_FINISH);
+  return strm->total_out;
+}
+
+void free_fused(void) {
+  if (fused.ready)
+    deflateEnd(&fused.strm);
+  free(fused.band);
+  memset(&fused, 0, sizeof(fused));
+}
+
+static uLongf compress_bitplanes(Image *image, unsigned char *bpl_data,
+                                 int bpl_size, unsigned char *compressed_data,
+                                 int interleaved) {
+  if (tile_set)
+    return compress_tiles(tile_set);
+  if (fused_mode || bpl_size >= FUSED_MIN_SIZE)
+    return compress_bitplanes_fused(image, interleaved);
+  c2p(image, bpl_data, interleaved);
+  uLongf compressed_size = compressBound(bpl_size);
+  compress(compressed_data, &compressed_size, bpl_data, bpl_size);
+  return compressed_size;
+}
+
+// Convert and compress current palette order, returning compressed size
+static uLongf evaluate(Image *image, unsigned char *bpl_data, int bpl_size,
+                       unsigned char *compressed_data, int interleaved,
+                       SearchContext *ctx) {
+  uLongf compressed_size = compress_bitplanes(image, bpl_data, bpl_size,
+                                              compressed_data, interleaved);
+  if (!ctx)
+    return compressed_size;
+
+  if (ctx->candidates)
+    track_candidate(ctx->candidates, image->palette_order, compressed_size);
+
+  // Score the same ordering on the sample to measure how representative it is
+  if (ctx->pair_sample) {
+    Sample *sample = ctx->pair_sample;
+    uLongf sample_size =
+        compress_bitplanes(&sample->image, sample->bpl_data, sample->bpl_size,
+                           sample->compressed_data, interleaved);
+    add_correlation_pair(ctx->correlation, sample_size, compressed_size);
+  }
+  return compressed_size;
+}
+
 uLongf compress_chunky(Image *image) {
   int chunky_size = image->width * image->height;
   uLongf compressed_size = compressBound(chunky_size);
@@ -66,15 +303,15 @@ uLongf compress_chunky(Image *image) {
 }
 
 // Greedy hill climbing algorithm with non-adjacent swaps
-void find_optimal_palette(Image *image, unsigned char *bpl_data, int bpl_size,
-                          int interleaved) {
+uLongf find_optimal_palette(Image *image, unsigned char *bpl_data,
+                            int bpl_size, int interleaved, SearchContext *ctx) {
   uLongf compressed_size = compressBound(bpl_size);
   unsigned char *compressed_data =
       (unsigned char *)safe_malloc(compressed_size);
 
   // Get initial compressed size
-  c2p(image, bpl_data, interleaved);
-  compress(compressed_data, &compressed_size, bpl_data, bpl_size);
+  compressed_size =
+      evaluate(image, bpl_data, bpl_size, compressed_data, interleaved, ctx);
   uLongf best_size = compressed_size;
   printf("Initial: %'lu\n", best_size);
 
@@ -88,14 +325,14 @@ void find_optimal_palette(Image *image, unsigned char *bpl_data, int bpl_size,
       if (is_locked(i))
         continue;
       for (int j = i + 1; j < max_color; j++) {
-        if (is_locked(j))
+        if (is_locked(j) || is_free_pair(i, j))
           continue;
         // Swap pair (and EHB counterparts if in EHB mode)
         swap_palette(image->palette_order, i, j);
 
         // Convert and compress new palette order
-        c2p(image, bpl_data, interleaved);
-        compress(compressed_data, &compressed_size, bpl_data, bpl_size);
+        compressed_size = evaluate(image, bpl_data, bpl_size, compressed_data,
+                                   interleaved, ctx);
 
         // New best size?
         if (compressed_size < best_size) {
@@ -114,18 +351,20 @@ void find_optimal_palette(Image *image, unsigned char *bpl_data, int bpl_size,
   printf("\n");
 
   free(compressed_data);
+  return best_size;
 }
 
 // Simulated-annealing
-void find_optimal_palette_sa(Image *image, unsigned char *bpl_data,
-                             int bpl_size, int interleaved) {
+uLongf find_optimal_palette_sa(Image *image, unsigned char *bpl_data,
+                               int bpl_size, int interleaved,
+                               SearchContext *ctx) {
   uLongf compressed_size = compressBound(bpl_size);
   unsigned char *compressed_data =
       (unsigned char *)safe_malloc(compressed_size);
 
   // Get initial compressed size
-  c2p(image, bpl_data, interleaved);
-  compress(compressed_data, &compressed_size, bpl_data, bpl_size);
+  compressed_size =
+      evaluate(image, bpl_data, bpl_size, compressed_data, interleaved, ctx);
   uLongf best_size = compressed_size;
   printf("Initial: %'lu\n", best_size);
 
@@ -136,6 +375,8 @@ void find_optimal_palette_sa(Image *image, unsigned char *bpl_data,
   double T = sa_start_temp;
   // In EHB mode, only swap among the base 32 colors
   int max_color = ehb_mode ? 32 : image->num_colors;
+  if (!has_swaps(max_color))
+    T = 0;
 
   while (T > sa_min_temp) {
     for (int iter = 0; iter < sa_iterations; iter++) {
@@ -147,15 +388,14 @@ void find_optimal_palette_sa(Image *image, unsigned char *bpl_data,
 
       do {
         j = rand() % max_color;
-      } while (is_locked(j) || j == i);
+      } while (is_locked(j) || j == i || is_free_pair(i, j));
 
       // Swap colors (and EHB counterparts if in EHB mode)
       swap_palette(image->palette_order, i, j);
 
       // Recompute compressed size
-      c2p(image, bpl_data, interleaved);
-      uLongf new_size = compressBound(bpl_size);
-      compress(compressed_data, &new_size, bpl_data, bpl_size);
+      uLongf new_size = evaluate(image, bpl_data, bpl_size, compressed_data,
+                                 interleaved, ctx);
 
       // Compute acceptance probability
       double delta = (double)(new_size - compressed_size);
@@ -188,6 +428,435 @@ void find_optimal_palette_sa(Image *image, unsigned char *bpl_data,
 
   free(compressed_data);
   free(best_order);
+  return best_size;
+}
+
+// Build a sample from bands of scanlines spread evenly across the image, sized
+// to fit the byte budget. Returns 0 if the budget would cover the whole image.
+int create_sample(const Image *image, int budget, Sample *sample) {
+  int row_bytes = (image->width / 8) * image->bitplanes;
+  int bands = budget / (row_bytes * SAMPLE_BAND_ROWS);
+  if (bands < 1)
+    bands = 1;
+  if (bands * SAMPLE_BAND_ROWS >= image->height)
+    return 0;
+
+  // Shares palette and palette order with the full image, so swaps apply to
+  // both
+  sample->image = *image;
+  sample->image.height = bands * SAMPLE_BAND_ROWS;
+  sample->image.data = safe_malloc(image->width * sample->image.height);
+  sample->bands = bands;
+
+  for (int b = 0; b < bands; b++) {
+    // Centre each band in its slice of the image
+    int start = (2 * b + 1) * image->height / (2 * bands) - SAMPLE_BAND_ROWS / 2;
+    if (start < 0)
+      start = 0;
+    if (start > image->height - SAMPLE_BAND_ROWS)
+      start = image->height - SAMPLE_BAND_ROWS;
+    memcpy(&sample->image.data[b * SAMPLE_BAND_ROWS * image->width],
+           &image->data[start * image->width],
+           SAMPLE_BAND_ROWS * image->width);
+  }
+
+  sample->bpl_size = row_bytes * sample->image.height;
+  sample->bpl_data = safe_malloc(sample->bpl_size);
+  sample->compressed_data = safe_malloc(compressBound(sample->bpl_size));
+  return 1;
+}
+
+void free_sample(Sample *sample) {
+  free(sample->image.data);
+  free(sample->bpl_data);
+  free(sample->compressed_data);
+}
+
+// Coarse-to-fine: optimise against sampled bands, then refine the best few
+// orderings with greedy hill climbing on the full image
+void find_optimal_palette_sampled(Image *image, Sample *sample,
+                                  unsigned char *bpl_data, int bpl_size,
+                                  int interleaved, int sa) {
+  Candidates candidates = {0};
+  candidates.max = sample_keep;
+  candidates.num_colors = image->num_colors;
+  candidates.orders = safe_malloc(sample_keep * sizeof(unsigned char *));
+  candidates.sizes = safe_malloc(sample_keep * sizeof(uLongf));
+  for (int k = 0; k < sample_keep; k++) {
+    candidates.orders[k] = safe_malloc(image->num_colors);
+  }
+
+  printf("Coarse pass: %d bands, %'d of %'d bytes\n", sample->bands,
+         sample->bpl_size, bpl_size);
+  SearchContext coarse = {&candidates, NULL, NULL};
+  if (sa) {
+    find_optimal_palette_sa(&sample->image, sample->bpl_data,
+                            sample->bpl_size, interleaved, &coarse);
+  } else {
+    find_optimal_palette(&sample->image, sample->bpl_data, sample->bpl_size,
+                         interleaved, &coarse);
+  }
+
+  // Sort candidates by sampled size, best first
+  for (int k = 1; k < candidates.count; k++) {
+    for (int l = k; l > 0 && candidates.sizes[l] < candidates.sizes[l - 1];
+         l--) {
+      uLongf size = candidates.sizes[l];
+      candidates.sizes[l] = candidates.sizes[l - 1];
+      candidates.sizes[l - 1] = size;
+      unsigned char *order = candidates.orders[l];
+      candidates.orders[l] = candidates.orders[l - 1];
+      candidates.orders[l - 1] = order;
+    }
+  }
+
+  // Refine on full image, scoring the sample alongside every evaluation
+  Correlation correlation = {0};
+  SearchContext refine = {NULL, sample, &correlation};
+  unsigned char *best_order = safe_malloc(image->num_colors);
+  uLongf best_size = 0;
+  for (int k = 0; k < candidates.count; k++) {
+    printf("Refining candidate %d/%d (sampled: %'lu)\n", k + 1,
+           candidates.count, candidates.sizes[k]);
+    memcpy(image->palette_order, candidates.orders[k], image->num_colors);
+    uLongf size =
+        find_optimal_palette(image, bpl_data, bpl_size, interleaved, &refine);
+    if (!k || size < best_size) {
+      best_size = size;
+      memcpy(best_order, image->palette_order, image->num_colors);
+    }
+  }
+  memcpy(image->palette_order, best_order, image->num_colors);
+  printf("Best: %'lu\n", best_size);
+
+  if (correlation.n > 1) {
+    printf("Sampled vs full size correlation: %.3f (%d evaluations)\n",
+           correlation_coefficient(&correlation), correlation.n);
+  }
+
+  free(best_order);
+  for (int k = 0; k < sample_keep; k++) {
+    free(candidates.orders[k]);
+  }
+  free(candidates.orders);
+  free(candidates.sizes);
+}
+
+static void put_float(unsigned char *buf, float val) {
+  uint32_t bits;
+  memcpy(&bits, &val, 4);
+  put_u32(buf, bits);
+}
+
+static float get_float(const unsigned char *buf) {
+  uint32_t bits = get_u32(buf);
+  float val;
+  memcpy(&val, &bits, 4);
+  return val;
+}
+
+// Serialise image for workers: dimensions and modes, lock flags, then chunky
+// pixel data
+unsigned char *pack_image(const Image *image, int interleaved, uint32_t *len) {
+  int pixels = image->width * image->height;
+  *len = 24 + image->num_colors + pixels;
+  unsigned char *buf = safe_malloc(*len);
+  put_u32(buf, image->width);
+  put_u32(buf + 4, image->height);
+  put_u32(buf + 8, image->num_colors);
+  put_u32(buf + 12, image->bitplanes);
+  put_u32(buf + 16, interleaved);
+  put_u32(buf + 20, ehb_mode);
+  for (int i = 0; i < image->num_colors; i++) {
+    buf[24 + i] = is_locked(i);
+  }
+  memcpy(buf + 24 + image->num_colors, image->data, pixels);
+  return buf;
+}
+
+static int unpack_image(const unsigned char *buf, uint32_t len, Image *image,
+                        int *interleaved) {
+  if (len < 24)
+    return 0;
+  uint32_t width = get_u32(buf);
+  uint32_t height = get_u32(buf + 4);
+  uint32_t num_colors = get_u32(buf + 8);
+  uint32_t bitplanes = get_u32(buf + 12);
+  uint32_t ehb = get_u32(buf + 20);
+
+  // Validate before trusting any sizes: c2p handles at most 8 bitplanes, and
+  // the pixel count mustn't overflow before it's checked against the length
+  uint64_t pixels = (uint64_t)width * height;
+  if (!width || !height || width % 16 || num_colors < 1 || num_colors > 256 ||
+      bitplanes < 1 || bitplanes > 8 || (ehb && num_colors != 64) ||
+      len < 24 + num_colors || pixels != len - 24 - num_colors)
+    return 0;
+  const unsigned char *data = buf + 24 + num_colors;
+  for (uint64_t i = 0; i < pixels; i++) {
+    if (data[i] >= num_colors)
+      return 0;
+  }
+
+  free_image(image);
+  image->width = width;
+  image->height = height;
+  image->num_colors = num_colors;
+  image->bitplanes = bitplanes;
+  *interleaved = get_u32(buf + 16);
+  ehb_mode = ehb;
+
+  free(locked_map);
+  locked_map = safe_calloc(num_colors, sizeof(int));
+  for (uint32_t i = 0; i < num_colors; i++) {
+    locked_map[i] = buf[24 + i];
+  }
+  image->palette_order = safe_malloc(num_colors);
+  image->data = safe_malloc(pixels);
+  memcpy(image->data, data, pixels);
+  return 1;
+}
+
+// Worker mode: receive the image once, then score batches of orderings or run
+// simulated-annealing chains until the coordinator disconnects
+int run_worker(const char *address) {
+  int fd = net_connect(address);
+  if (fd < 0) {
+    error_log("Error: Could not connect to %s\n", address);
+    return EXIT_FAILURE;
+  }
+  printf("Connected to %s\n", address);
+
+  Image image = {0};
+  int interleaved = 0;
+  int bpl_size = 0;
+  unsigned char *bpl_data = NULL;
+  unsigned char *compressed_data = NULL;
+  uint32_t type, len;
+  unsigned char *payload;
+  int status = EXIT_SUCCESS;
+
+  while (recv_message(fd, &type, &payload, &len)) {
+    int n = image.num_colors;
+    if (type == MSG_IMAGE) {
+      if (!unpack_image(payload, len, &image, &interleaved)) {
+        error_log("Error: Invalid image message\n");
+        status = EXIT_FAILURE;
+        free(payload);
+        break;
+      }
+      find_unused_colors(&image);
+      bpl_size = (image.width / 8) * image.height * image.bitplanes;
+      bpl_data = safe_realloc(bpl_data, bpl_size);
+      compressed_data = safe_realloc(compressed_data, compressBound(bpl_size));
+      verbose_log("%d x %d, %d colors\n", image.width, image.height,
+                  image.num_colors);
+    } else if (type == MSG_SCORE && n && len >= 4 && (len - 4) % n == 0 &&
+               get_u32(payload) == (len - 4) / n) {
+      // Checked by division so a huge count can't wrap around
+      uint32_t count = get_u32(payload);
+      unsigned char *result = safe_malloc((size_t)count * 4);
+      for (uint32_t k = 0; k < count; k++) {
+        memcpy(image.palette_order, payload + 4 + k * n, n);
+        put_u32(result + k * 4, evaluate(&image, bpl_data, bpl_size,
+                                         compressed_data, interleaved, NULL));
+      }
+      int sent = send_message(fd, MSG_RESULT, result, count * 4);
+      free(result);
+      if (!sent) {
+        free(payload);
+        break;
+      }
+    } else if (type == MSG_CHAIN && n && len == 20 + (uint32_t)n) {
+      srand(get_u32(payload));
+      sa_start_temp = get_float(payload + 4);
+      sa_cooling = get_float(payload + 8);
+      sa_min_temp = get_float(payload + 12);
+      sa_iterations = get_u32(payload + 16);
+      memcpy(image.palette_order, payload + 20, n);
+      uLongf size = find_optimal_palette_sa(&image, bpl_data, bpl_size,
+                                            interleaved, NULL);
+      unsigned char *result = safe_malloc(4 + n);
+      put_u32(result, size);
+      memcpy(result + 4, image.palette_order, n);
+      int sent = send_message(fd, MSG_RESULT, result, 4 + n);
+      free(result);
+      if (!sent) {
+        free(payload);
+        break;
+      }
+    } else {
+      error_log("Error: Unexpected or malformed message (type %u)\n", type);
+      status = EXIT_FAILURE;
+      free(payload);
+      break;
+    }
+    free(payload);
+  }
+
+  verbose_log("Coordinator disconnected\n");
+  net_close(fd);
+  free_fused();
+  free(bpl_data);
+  free(compressed_data);
+  free_image(&image);
+  return status;
+}
+
+// Score orderings on the worker pool, split into batches
+static void score_orders(Pool *pool, const unsigned char *orders, int count,
+                         int num_colors, uLongf *sizes) {
+  int num_jobs = (count + DIST_BATCH - 1) / DIST_BATCH;
+  Job *jobs = safe_calloc(num_jobs, sizeof(Job));
+  for (int j = 0; j < num_jobs; j++) {
+    int batch = count - j * DIST_BATCH;
+    if (batch > DIST_BATCH)
+      batch = DIST_BATCH;
+    jobs[j].type = MSG_SCORE;
+    jobs[j].len = 4 + batch * num_colors;
+    jobs[j].expected_len = batch * 4;
+    jobs[j].payload = safe_malloc(jobs[j].len);
+    put_u32(jobs[j].payload, batch);
+    memcpy(jobs[j].payload + 4, orders + j * DIST_BATCH * num_colors,
+           batch * num_colors);
+  }
+
+  run_jobs(pool, jobs, num_jobs);
+
+  for (int j = 0; j < num_jobs; j++) {
+    int batch = (jobs[j].len - 4) / num_colors;
+    for (int k = 0; k < batch; k++) {
+      sizes[j * DIST_BATCH + k] = get_u32(jobs[j].result + k * 4);
+    }
+  }
+  free_jobs(jobs, num_jobs);
+  free(jobs);
+}
+
+// Greedy hill climbing with swaps scored on the worker pool. Swaps following
+// the current order are scored speculatively in waves; keeping only the first
+// improvement in each wave gives the same result as the sequential search.
+uLongf find_optimal_palette_distributed(Pool *pool, Image *image) {
+  int n = image->num_colors;
+  // In EHB mode, only swap among the base 32 colors
+  int max_color = ehb_mode ? 32 : n;
+
+  // Unlocked swap pairs, in sequential search order
+  int *pairs = safe_malloc(max_color * max_color * sizeof(int));
+  int num_pairs = 0;
+  for (int i = 0; i < max_color; i++) {
+    if (is_locked(i))
+      continue;
+    for (int j = i + 1; j < max_color; j++) {
+      if (is_locked(j) || is_free_pair(i, j))
+        continue;
+      pairs[num_pairs * 2] = i;
+      pairs[num_pairs * 2 + 1] = j;
+      num_pairs++;
+    }
+  }
+
+  uLongf best_size;
+  score_orders(pool, image->palette_order, 1, n, &best_size);
+  printf("Initial: %'lu\n", best_size);
+
+  unsigned char *orders = safe_malloc(num_pairs * n);
+  uLongf *sizes = safe_malloc(num_pairs * sizeof(uLongf));
+
+  int improved = 1;
+  while (improved) {
+    improved = 0;
+    int cursor = 0;
+    while (cursor < num_pairs) {
+      int workers = pool->num_workers > 0 ? pool->num_workers : 1;
+      int wave = workers * DIST_BATCH;
+      if (wave > num_pairs - cursor)
+        wave = num_pairs - cursor;
+
+      for (int k = 0; k < wave; k++) {
+        unsigned char *order = orders + k * n;
+        memcpy(order, image->palette_order, n);
+        swap_palette(order, pairs[(cursor + k) * 2],
+                     pairs[(cursor + k) * 2 + 1]);
+      }
+      score_orders(pool, orders, wave, n, sizes);
+
+      int accepted = -1;
+      for (int k = 0; k < wave; k++) {
+        if (sizes[k] < best_size) {
+          accepted = k;
+          break;
+        }
+      }
+      if (accepted < 0) {
+        cursor += wave;
+        continue;
+      }
+
+      memcpy(image->palette_order, orders + accepted * n, n);
+      improved = 1;
+      best_size = sizes[accepted];
+      printf("\rBest: %'lu   ", best_size);
+      fflush(stdout);
+      cursor += accepted + 1;
+    }
+  }
+  printf("\n");
+
+  free(pairs);
+  free(orders);
+  free(sizes);
+  return best_size;
+}
+
+// Chain results end with the order found, which must be a permutation before
+// it's used to index the palette
+static int valid_chain_result(const unsigned char *result, uint32_t len) {
+  int n = len - 4;
+  unsigned char seen[256] = {0};
+  for (int i = 0; i < n; i++) {
+    if (result[4 + i] >= n || seen[result[4 + i]]++)
+      return 0;
+  }
+  return 1;
+}
+
+// Independent simulated-annealing chains run on the worker pool, keeping the
+// best result
+uLongf find_optimal_palette_sa_distributed(Pool *pool, Image *image,
+                                           int chains) {
+  int n = image->num_colors;
+  Job *jobs = safe_calloc(chains, sizeof(Job));
+  for (int c = 0; c < chains; c++) {
+    jobs[c].type = MSG_CHAIN;
+    jobs[c].len = 20 + n;
+    jobs[c].expected_len = 4 + n;
+    jobs[c].check_result = valid_chain_result;
+    jobs[c].payload = safe_malloc(jobs[c].len);
+    put_u32(jobs[c].payload, rand());
+    put_float(jobs[c].payload + 4, sa_start_temp);
+    put_float(jobs[c].payload + 8, sa_cooling);
+    put_float(jobs[c].payload + 12, sa_min_temp);
+    put_u32(jobs[c].payload + 16, sa_iterations);
+    memcpy(jobs[c].payload + 20, image->palette_order, n);
+  }
+
+  printf("Running %d chains\n", chains);
+  run_jobs(pool, jobs, chains);
+
+  uLongf best_size = 0;
+  for (int c = 0; c < chains; c++) {
+    uLongf size = get_u32(jobs[c].result);
+    verbose_log("Chain %d: %'lu\n", c + 1, size);
+    if (!c || size < best_size) {
+      best_size = size;
+      memcpy(image->palette_order, jobs[c].result + 4, n);
+    }
+  }
+  printf("Best: %'lu\n", best_size);
+
+  free_jobs(jobs, chains);
+  free(jobs);
+  return best_size;
 }
 
 void print_palette(const Image *image) {
@@ -206,11 +875,14 @@ void print_palette(const Image *image) {
 
 void print_usage(const char *prog_name) {
   printf("Usage: %s [options] <input.png> <output.png>\n", prog_name);
+  printf("       %s [options] --worker=ADDR\n", prog_name);
   printf("Options:\n");
   printf("  -e, --ehb                  EHB mode (64 colors, upper 32 mirror lower 32)\n");
   printf("  -i, --interleaved          Enable interleaved mode\n");
   printf(
       "  -l, --lock=INDEXES         Lock palette indexes (comma separated)\n");
+  printf("  -u, --remove-unused        Remove unused colors from palette\n");
+  printf("  -d, --merge-duplicates     Merge colors with identical RGB values\n");
   printf("  -s, --simulated-annealing  Use simulated annealing\n");
   printf("  -t, --sa-start-temp        Starting temperature [default: %.1f]\n",
          sa_start_temp);
@@ -222,6 +894,28 @@ void print_usage(const char *prog_name) {
   printf("  -I, --sa-iterations        Number of swaps per temperature step "
          "[default: %d]\n",
          sa_iterations);
+  printf("  -S, --sample=BYTES         Optimise on sampled bands of this many "
+         "bytes first,\n"
+         "                             then refine on the full image\n");
+  printf("  -k, --sample-keep=N        Number of sampled orderings to refine "
+         "[default: %d]\n",
+         sample_keep);
+  printf("  -L, --listen=ADDR          Coordinate workers listening on "
+         "HOST:PORT or unix:PATH\n");
+  printf("  -w, --min-workers=N        Workers to wait for before starting "
+         "[default: %d]\n",
+         min_workers);
+  printf("  -C, --chains=N             Independent SA chains to run on workers "
+         "[default: 1 per worker]\n");
+  printf("  -W, --worker=ADDR          Run as a worker for the coordinator at "
+         "ADDR\n");
+  printf("  -f, --fused                Always use fused c2p and compression "
+         "[default: from %dK]\n",
+         FUSED_MIN_SIZE / 1024);
+  printf("  -T, --tile=WxH             Score as sum of separately packed "
+         "tiles\n");
+  printf("  -j, --jobs=N               Tiles to compress in parallel "
+         "[default: one per CPU]\n");
   printf("  -v, --verbose              Enable verbose output\n");
   printf("  -h, --help                 Display this help message\n");
 }
@@ -230,6 +924,12 @@ int main(int argc, char *argv[]) {
   int interleaved = 0;
   int sa = 0;
   char *lock_list = NULL;
+  char *listen_address = NULL;
+  char *worker_address = NULL;
+  int tile_width = 0, tile_height = 0;
+  int jobs = 0;
+  int remove_unused = 0;
+  int merge_duplicates = 0;
   int opt;
 
   setlocale(LC_NUMERIC, ""); // Use system's locale (e.g., `en_US`)
@@ -245,10 +945,21 @@ int main(int argc, char *argv[]) {
       {"sa-min-temp", required_argument, 0, 'm'},
       {"sa-min-iterations", required_argument, 0, 'I'},
       {"lock", required_argument, 0, 'l'},
+      {"remove-unused", no_argument, 0, 'u'},
+      {"merge-duplicates", no_argument, 0, 'd'},
+      {"sample", required_argument, 0, 'S'},
+      {"sample-keep", required_argument, 0, 'k'},
+      {"listen", required_argument, 0, 'L'},
+      {"min-workers", required_argument, 0, 'w'},
+      {"chains", required_argument, 0, 'C'},
+      {"worker", required_argument, 0, 'W'},
+      {"fused", no_argument, 0, 'f'},
+      {"tile", required_argument, 0, 'T'},
+      {"jobs", required_argument, 0, 'j'},
       {"help", no_argument, 0, 'h'},
       {0, 0, 0, 0}};
 
-  while ((opt = getopt_long(argc, argv, "eivst:c:m:I:l:h", long_options, NULL)) != -1) {
+  while ((opt = getopt_long(argc, argv, "eivst:c:m:I:l:udS:k:L:w:C:W:fT:j:h", long_options, NULL)) != -1) {
     switch (opt) {
     case 'e':
       ehb_mode = 1;
@@ -277,6 +988,46 @@ int main(int argc, char *argv[]) {
     case 'l':
       lock_list = optarg;
       break;
+    case 'u':
+      remove_unused = 1;
+      break;
+    case 'd':
+      merge_duplicates = 1;
+      break;
+    case 'S':
+      sample_budget = atoi(optarg);
+      break;
+    case 'k':
+      sample_keep = atoi(optarg);
+      if (sample_keep < 1) {
+        error_log("Error: Sample keep count must be at least 1\n");
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'L':
+      listen_address = optarg;
+      break;
+    case 'w':
+      min_workers = atoi(optarg);
+      break;
+    case 'C':
+      num_chains = atoi(optarg);
+      break;
+    case 'W':
+      worker_address = optarg;
+      break;
+    case 'f':
+      fused_mode = 1;
+      break;
+    case 'T':
+      if (sscanf(optarg, "%dx%d", &tile_width, &tile_height) != 2) {
+        error_log("Error: Tile size must be WxH\n");
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'j':
+      jobs = atoi(optarg);
+      break;
     case 'h':
       print_usage(argv[0]);
       return EXIT_SUCCESS;
@@ -286,6 +1037,20 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (worker_address) {
+    return run_worker(worker_address);
+  }
+
+  if (listen_address && sample_budget) {
+    error_log("Error: Sampling can't be combined with distributed mode\n");
+    return EXIT_FAILURE;
+  }
+  if (tile_width && (listen_address || sample_budget)) {
+    error_log("Error: Tile mode can't be combined with sampling or "
+              "distributed mode\n");
+    return EXIT_FAILURE;
+  }
+
   // Ensure we have at least two positional arguments: input and output file
   if (optind + 2 != argc) {
     error_log("Error: Incorrect number of arguments.\n");
@@ -311,14 +1076,6 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
-  // Get compressed size of chunky data
-  uLongf chunky_compressed = compress_chunky(&image);
-  printf("Compressed chunky size %'lu\n", chunky_compressed);
-
-  // Allocate bitplane data
-  int bpl_size = (image.width / 8) * image.height * image.bitplanes;
-  unsigned char *bpl_data = safe_malloc(bpl_size);
-
   if (lock_list) {
     parse_locked_indexes(lock_list, image.num_colors);
     if (ehb_mode) {
@@ -331,18 +1088,107 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (remove_unused || merge_duplicates) {
+    if (ehb_mode) {
+      error_log("Error: Palette compaction can't be used in EHB mode\n");
+      free_image(&image);
+      return EXIT_FAILURE;
+    }
+    int old_colors = image.num_colors;
+    int old_bitplanes = image.bitplanes;
+    int *remap = safe_malloc(old_colors * sizeof(int));
+    compact_palette(&image, remove_unused, merge_duplicates, remap);
+    printf("Compacted palette: %d -> %d colors, %d -> %d bitplanes\n",
+           old_colors, image.num_colors, old_bitplanes, image.bitplanes);
+
+    // Lock indexes refer to the original palette
+    if (locked_map) {
+      int *old_locked = locked_map;
+      locked_map = safe_calloc(image.num_colors, sizeof(int));
+      for (int i = 0; i < old_colors; i++) {
+        if (old_locked[i] && remap[i] >= 0)
+          locked_map[remap[i]] = 1;
+      }
+      free(old_locked);
+    }
+    free(remap);
+  }
+  find_unused_colors(&image);
+
+  // Get compressed size of chunky data
+  uLongf chunky_compressed = compress_chunky(&image);
+  printf("Compressed chunky size %'lu\n", chunky_compressed);
+
+  // Allocate bitplane data
+  int bpl_size = (image.width / 8) * image.height * image.bitplanes;
+  unsigned char *bpl_data = safe_malloc(bpl_size);
+
   verbose_log("EHB mode: %s\n", ehb_mode ? "ON" : "OFF");
   verbose_log("Interleaved mode: %s\n", interleaved ? "ON" : "OFF");
 
+  TileSet tiles;
+  if (tile_width) {
+    if (!check_tile_size(&image, tile_width, tile_height)) {
+      free(bpl_data);
+      free_image(&image);
+      return EXIT_FAILURE;
+    }
+    create_tiles(&tiles, &image, tile_width, tile_height, interleaved,
+                 jobs > 0 ? jobs : default_jobs());
+    tile_set = &tiles;
+    verbose_log("Tile mode: %d tiles of %d x %d\n", tiles.num_tiles,
+                tile_width, tile_height);
+  }
+
+  Sample sample = {0};
+  int sampled = 0;
+  if (sample_budget > 0) {
+    sampled = create_sample(&image, sample_budget, &sample);
+    if (!sampled) {
+      verbose_log("Sample budget covers whole image, ignoring\n");
+    }
+  }
+
   if (sa) {
     verbose_log("Simulated Annealing:\nstart %.2f, cooling %.2f, min %.2f, iterations %d\n",
                 sa_start_temp, sa_cooling, sa_min_temp, sa_iterations);
-    find_optimal_palette_sa(&image, bpl_data, bpl_size, interleaved);
   } else {
     verbose_log("Using greedy hill climbing algorithm\n");
-    find_optimal_palette(&image, bpl_data, bpl_size, interleaved);
+  }
+
+  if (listen_address) {
+    uint32_t image_len;
+    unsigned char *image_msg = pack_image(&image, interleaved, &image_len);
+    Pool pool;
+    if (!pool_open(&pool, listen_address, image_msg, image_len)) {
+      free(image_msg);
+      free(bpl_data);
+      free_image(&image);
+      return EXIT_FAILURE;
+    }
+    pool_wait(&pool, min_workers);
+    if (sa) {
+      int chains = num_chains > 0 ? num_chains : pool.num_workers;
+      find_optimal_palette_sa_distributed(&pool, &image, chains);
+    } else {
+      find_optimal_palette_distributed(&pool, &image);
+    }
+    pool_close(&pool);
+    free(image_msg);
+  } else if (sampled) {
+    find_optimal_palette_sampled(&image, &sample, bpl_data, bpl_size,
+                                 interleaved, sa);
+    free_sample(&sample);
+  } else if (sa) {
+    find_optimal_palette_sa(&image, bpl_data, bpl_size, interleaved, NULL);
+  } else {
+    find_optimal_palette(&image, bpl_data, bpl_size, interleaved, NULL);
   }
   free(bpl_data);
+  if (tile_set) {
+    free_tiles(tile_set);
+    tile_set = NULL;
+  }
 
   print_palette(&image);
 
@@ -352,6 +1198,8 @@ int main(int argc, char *argv[]) {
   free_image(&image);
   if (locked_map)
     free(locked_map);
+  free(unused_map);
+  free_fused();
 
   verbose_log("Optimisation complete!\n");
   return EXIT_SUCCESS;
@@ -0,0 +1,29 @@
+#ifndef BYTE_ORDER_H
+#define BYTE_ORDER_H
+
+#include <stdint.h>
+
+// Reading and writing big-endian values, as used by all formats and messages
+
+static inline void put_u16(unsigned char *buf, uint16_t val) {
+  buf[0] = val >> 8;
+  buf[1] = val;
+}
+
+static inline void put_u32(unsigned char *buf, uint32_t val) {
+  buf[0] = val >> 24;
+  buf[1] = val >> 16;
+  buf[2] = val >> 8;
+  buf[3] = val;
+}
+
+static inline uint16_t get_u16(const unsigned char *buf) {
+  return (buf[0] << 8) | buf[1];
+}
+
+static inline uint32_t get_u32(const unsigned char *buf) {
+  return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+         ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+#endif
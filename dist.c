@@ -0,0 +1,343 @@
+// Distributed evaluation: message framing over TCP / Unix sockets and a pool
+// of workers that can join and leave while jobs are running
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "byte_order.h"
+#include "dist.h"
+#include "log.h"
+#include "safe_mem.h"
+
+#define MAX_MESSAGE (256 * 1024 * 1024)
+
+enum { JOB_PENDING, JOB_RUNNING, JOB_DONE };
+
+// Addresses are either `unix:PATH` or `HOST:PORT`, where an empty host means
+// any interface when listening
+static int is_unix_address(const char *address) {
+  return !strncmp(address, "unix:", 5);
+}
+
+static int unix_address(const char *address, struct sockaddr_un *addr) {
+  const char *path = address + 5;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    error_log("Error: Socket path too long: %s\n", path);
+    return 0;
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+  return 1;
+}
+
+static struct addrinfo *tcp_address(const char *address, int passive) {
+  const char *sep = strrchr(address, ':');
+  if (!sep) {
+    error_log("Error: Address must be HOST:PORT or unix:PATH: %s\n", address);
+    return NULL;
+  }
+  char host[256];
+  size_t host_len = sep - address;
+  if (host_len >= sizeof(host)) {
+    error_log("Error: Host name too long: %s\n", address);
+    return NULL;
+  }
+  memcpy(host, address, host_len);
+  host[host_len] = 0;
+
+  struct addrinfo hints = {0};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+  struct addrinfo *res;
+  int err = getaddrinfo(host_len ? host : NULL, sep + 1, &hints, &res);
+  if (err) {
+    error_log("Error: Could not resolve %s: %s\n", address, gai_strerror(err));
+    return NULL;
+  }
+  return res;
+}
+
+static int net_listen(const char *address) {
+  if (is_unix_address(address)) {
+    struct sockaddr_un addr;
+    if (!unix_address(address, &addr))
+      return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    unlink(addr.sun_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, MAX_WORKERS) < 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  struct addrinfo *res = tcp_address(address, 1);
+  if (!res)
+    return -1;
+  int fd = -1;
+  for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, MAX_WORKERS))
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+int net_connect(const char *address) {
+  if (is_unix_address(address)) {
+    struct sockaddr_un addr;
+    if (!unix_address(address, &addr))
+      return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  struct addrinfo *res = tcp_address(address, 0);
+  if (!res)
+    return -1;
+  int fd = -1;
+  for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (!connect(fd, ai->ai_addr, ai->ai_addrlen))
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+void net_close(int fd) { close(fd); }
+
+static int send_all(int fd, const void *buf, size_t len) {
+  const unsigned char *p = buf;
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n <= 0)
+      return 0;
+    p += n;
+    len -= n;
+  }
+  return 1;
+}
+
+static int recv_all(int fd, void *buf, size_t len) {
+  unsigned char *p = buf;
+  while (len) {
+    ssize_t n = read(fd, p, len);
+    if (n <= 0)
+      return 0;
+    p += n;
+    len -= n;
+  }
+  return 1;
+}
+
+// Messages are framed as type and payload length, followed by the payload
+int send_message(int fd, uint32_t type, const void *payload, uint32_t len) {
+  unsigned char header[8];
+  put_u32(header, type);
+  put_u32(header + 4, len);
+  return send_all(fd, header, 8) && send_all(fd, payload, len);
+}
+
+// Receive a message, allocating its payload. Returns 0 on disconnect.
+int recv_message(int fd, uint32_t *type, unsigned char **payload,
+                 uint32_t *len) {
+  unsigned char header[8];
+  if (!recv_all(fd, header, 8))
+    return 0;
+  *type = get_u32(header);
+  *len = get_u32(header + 4);
+  if (*len > MAX_MESSAGE)
+    return 0;
+  *payload = safe_malloc(*len);
+  if (!recv_all(fd, *payload, *len)) {
+    free(*payload);
+    *payload = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+int pool_open(Pool *pool, const char *address, unsigned char *image_msg,
+              uint32_t image_len) {
+  // Lost workers are detected from write errors instead
+  signal(SIGPIPE, SIG_IGN);
+
+  memset(pool, 0, sizeof(*pool));
+  pool->address = address;
+  pool->image_msg = image_msg;
+  pool->image_len = image_len;
+  pool->listen_fd = net_listen(address);
+  if (pool->listen_fd < 0) {
+    error_log("Error: Could not listen on %s\n", address);
+    return 0;
+  }
+  printf("Listening for workers on %s\n", address);
+  return 1;
+}
+
+void pool_close(Pool *pool) {
+  for (int w = 0; w < pool->num_workers; w++) {
+    close(pool->workers[w].fd);
+  }
+  pool->num_workers = 0;
+  close(pool->listen_fd);
+  if (is_unix_address(pool->address))
+    unlink(pool->address + 5);
+}
+
+static void drop_worker(Pool *pool, Job *jobs, int w) {
+  Worker *worker = &pool->workers[w];
+  if (worker->job >= 0) {
+    jobs[worker->job].state = JOB_PENDING;
+  }
+  close(worker->fd);
+  *worker = pool->workers[--pool->num_workers];
+  printf("\nWorker left (%d connected)\n", pool->num_workers);
+}
+
+static int valid_result(const Job *job, const unsigned char *result,
+                        uint32_t len) {
+  return len == job->expected_len &&
+         (!job->check_result || job->check_result(result, len));
+}
+
+static void accept_worker(Pool *pool) {
+  int fd = accept(pool->listen_fd, NULL, NULL);
+  if (fd < 0)
+    return;
+  if (pool->num_workers == MAX_WORKERS) {
+    error_log("Warning: Too many workers, rejecting connection\n");
+    close(fd);
+    return;
+  }
+  // Workers get the image once on joining
+  if (!send_message(fd, MSG_IMAGE, pool->image_msg, pool->image_len)) {
+    close(fd);
+    return;
+  }
+  pool->workers[pool->num_workers++] = (Worker){fd, -1};
+  printf("\nWorker joined (%d connected)\n", pool->num_workers);
+}
+
+// Wait until at least `min_workers` workers have joined
+void pool_wait(Pool *pool, int min_workers) {
+  while (pool->num_workers < min_workers) {
+    accept_worker(pool);
+  }
+}
+
+// Run jobs on the pool, blocking until all have valid results. Jobs held by
+// workers that leave or send an invalid result are requeued, and workers
+// joining mid-run are put to work.
+void run_jobs(Pool *pool, Job *jobs, int num_jobs) {
+  struct pollfd fds[MAX_WORKERS + 1];
+  int done = 0;
+  for (int j = 0; j < num_jobs; j++) {
+    jobs[j].state = JOB_PENDING;
+  }
+
+  while (done < num_jobs) {
+    // Hand out pending jobs to idle workers
+    int next = 0;
+    for (int w = 0; w < pool->num_workers; w++) {
+      Worker *worker = &pool->workers[w];
+      if (worker->job >= 0)
+        continue;
+      while (next < num_jobs && jobs[next].state != JOB_PENDING)
+        next++;
+      if (next == num_jobs)
+        break;
+      if (!send_message(worker->fd, jobs[next].type, jobs[next].payload,
+                        jobs[next].len)) {
+        drop_worker(pool, jobs, w--);
+        continue;
+      }
+      worker->job = next;
+      jobs[next].state = JOB_RUNNING;
+    }
+
+    if (!pool->num_workers) {
+      printf("\nWaiting for workers on %s\n", pool->address);
+    }
+
+    fds[0] = (struct pollfd){pool->listen_fd, POLLIN, 0};
+    for (int w = 0; w < pool->num_workers; w++) {
+      fds[w + 1] = (struct pollfd){pool->workers[w].fd, POLLIN, 0};
+    }
+    int num_fds = pool->num_workers + 1;
+    if (poll(fds, num_fds, -1) < 0)
+      continue;
+
+    // Collect results, in reverse so dropping a worker doesn't disturb the
+    // indexes still to be checked
+    for (int w = num_fds - 2; w >= 0; w--) {
+      if (!fds[w + 1].revents)
+        continue;
+      Worker *worker = &pool->workers[w];
+      uint32_t type;
+      unsigned char *payload = NULL;
+      uint32_t len;
+      if (!recv_message(worker->fd, &type, &payload, &len) ||
+          type != MSG_RESULT || worker->job < 0) {
+        free(payload);
+        drop_worker(pool, jobs, w);
+        continue;
+      }
+      Job *job = &jobs[worker->job];
+      if (!valid_result(job, payload, len)) {
+        error_log("\nWarning: Invalid result from worker, requeuing job\n");
+        free(payload);
+        drop_worker(pool, jobs, w);
+        continue;
+      }
+      job->result = payload;
+      job->result_len = len;
+      job->state = JOB_DONE;
+      worker->job = -1;
+      done++;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      accept_worker(pool);
+    }
+  }
+}
+
+void free_jobs(Job *jobs, int num_jobs) {
+  for (int j = 0; j < num_jobs; j++) {
+    free(jobs[j].payload);
+    free(jobs[j].result);
+  }
+}
@@ -0,0 +1,51 @@
+#include <stdint.h>
+
+#define MAX_WORKERS 64
+
+// Message types
+enum {
+  MSG_IMAGE = 1, // Coordinator -> worker: image to evaluate
+  MSG_SCORE,     // Coordinator -> worker: batch of palette orders to score
+  MSG_CHAIN,     // Coordinator -> worker: run a simulated-annealing chain
+  MSG_RESULT,    // Worker -> coordinator: job result
+};
+
+typedef struct {
+  uint32_t type;
+  unsigned char *payload;
+  uint32_t len;
+  uint32_t expected_len; // Length of a valid result
+  // Optional further check of a result, which is rejected if it returns 0
+  int (*check_result)(const unsigned char *result, uint32_t len);
+  unsigned char *result;
+  uint32_t result_len;
+  int state;
+} Job;
+
+typedef struct {
+  int fd;
+  int job; // Index of job in flight, or -1 if idle
+} Worker;
+
+typedef struct {
+  const char *address;
+  int listen_fd;
+  Worker workers[MAX_WORKERS];
+  int num_workers;
+  unsigned char *image_msg; // Sent to every worker on joining
+  uint32_t image_len;
+} Pool;
+
+int net_connect(const char *address);
+void net_close(int fd);
+
+int send_message(int fd, uint32_t type, const void *payload, uint32_t len);
+int recv_message(int fd, uint32_t *type, unsigned char **payload,
+                 uint32_t *len);
+
+int pool_open(Pool *pool, const char *address, unsigned char *image_msg,
+              uint32_t image_len);
+void pool_close(Pool *pool);
+void pool_wait(Pool *pool, int min_workers);
+void run_jobs(Pool *pool, Job *jobs, int num_jobs);
+void free_jobs(Job *jobs, int num_jobs);
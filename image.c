@@ -38,6 +38,7 @@ Image read_png_indexed(char *input_file) {
       png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
   if (!png) {
     error_log("Error: Failed to create PNG read struct.\n");
+    fclose(fp);
     return image;
   }
 
@@ -45,12 +46,14 @@ Image read_png_indexed(char *input_file) {
   if (!info) {
     error_log("Error: Failed to create PNG info struct.\n");
     png_destroy_read_struct(&png, NULL, NULL);
+    fclose(fp);
     return image;
   }
 
   if (setjmp(png_jmpbuf(png))) {
     error_log("Error: PNG reading failed.\n");
     png_destroy_read_struct(&png, &info, NULL);
+    fclose(fp);
     return image;
   }
 
@@ -60,6 +63,7 @@ Image read_png_indexed(char *input_file) {
       png_get_bit_depth(png, info) != 8) {
     error_log("Error: Not an 8-bit indexed PNG.\n");
     png_destroy_read_struct(&png, &info, NULL);
+    fclose(fp);
     return image;
   }
 
@@ -68,6 +72,7 @@ Image read_png_indexed(char *input_file) {
   if (!png_get_PLTE(png, info, &temp_palette, &num_colors)) {
     error_log("Error: Failed to get PNG palette.\n");
     png_destroy_read_struct(&png, &info, NULL);
+    fclose(fp);
     return image;
   }
 
@@ -86,8 +91,9 @@ Image read_png_indexed(char *input_file) {
 
   if (image.width % 16) {
     error_log("Error: Image width must be a multiple of 16.\n");
-    free(image.palette);
+    free_image(&image);
     png_destroy_read_struct(&png, &info, NULL);
+    fclose(fp);
     return image;
   }
 
@@ -102,6 +108,7 @@ Image read_png_indexed(char *input_file) {
   png_read_image(png, row_pointers);
   free(row_pointers);
   png_destroy_read_struct(&png, &info, NULL);
+  fclose(fp);
 
   image.success = 1;
   return image;
@@ -177,17 +184,93 @@ void write_png_indexed(const char *filename, const Image *image) {
   printf("Updated PNG written to %s\n", filename);
 }
 
-// Chunky to planar conversion
-void c2p(const Image *image, unsigned char *bpl_data, int interleaved) {
-  int byte_width = image->width / 8;
-  int row_size = interleaved ? image->bitplanes * byte_width : byte_width;
-  int bpl_offset = interleaved ? byte_width : image->height * byte_width;
+// Count pixels using each palette entry
+void color_histogram(const Image *image, int *counts) {
+  memset(counts, 0, image->num_colors * sizeof(int));
+  for (int i = 0; i < image->width * image->height; i++) {
+    if (image->data[i] < image->num_colors)
+      counts[image->data[i]]++;
+  }
+}
 
-  memset(bpl_data, 0, byte_width * image->height * image->bitplanes);
+// Remove unused palette entries and / or merge exact RGB duplicates into the
+// first kept entry, remapping pixel data and reducing bitplanes where
+// possible. Fills `remap` with each old index's new index (-1 if removed) and
+// returns the new number of colors. Palette order is reset.
+int compact_palette(Image *image, int remove_unused, int merge_duplicates,
+                    int *remap) {
+  int *counts = safe_malloc(image->num_colors * sizeof(int));
+  color_histogram(image, counts);
 
-  int i = 0;
-  for (int y = 0; y < image->height; y++) {
-    int row_start = y * row_size;
+  int num_colors = 0;
+  for (int i = 0; i < image->num_colors; i++) {
+    remap[i] = -1;
+    if (remove_unused && !counts[i])
+      continue;
+    if (merge_duplicates) {
+      for (int j = 0; j < i; j++) {
+        if (remap[j] >= 0 && image->palette[j].red == image->palette[i].red &&
+            image->palette[j].green == image->palette[i].green &&
+            image->palette[j].blue == image->palette[i].blue) {
+          remap[i] = remap[j];
+          break;
+        }
+      }
+      if (remap[i] >= 0)
+        continue;
+    }
+    image->palette[num_colors] = image->palette[i];
+    remap[i] = num_colors++;
+  }
+  free(counts);
+
+  for (int i = 0; i < image->width * image->height; i++) {
+    if (image->data[i] < image->num_colors)
+      image->data[i] = remap[image->data[i]];
+  }
+
+  image->num_colors = num_colors;
+  for (int i = 0; i < num_colors; i++) {
+    image->palette_order[i] = i;
+  }
+  image->bitplanes = num_colors > 1 ? (int)ceil(log2(num_colors)) : 1;
+  return num_colors;
+}
+
+// Copy a region of pixel data into a new image. Palette and palette order are
+// shared with the source, so only `data` should be freed.
+Image crop_image(const Image *image, int x, int y, int width, int height) {
+  Image crop = *image;
+  crop.width = width;
+  crop.height = height;
+  crop.data = safe_malloc(width * height);
+  for (int row = 0; row < height; row++) {
+    memcpy(&crop.data[row * width], &image->data[(y + row) * image->width + x],
+           width);
+  }
+  return crop;
+}
+
+// Tiles must be word aligned and divide the image exactly
+int check_tile_size(const Image *image, int tile_width, int tile_height) {
+  if (tile_width <= 0 || tile_height <= 0 || tile_width % 16) {
+    error_log("Error: Tile width must be a multiple of 16.\n");
+    return 0;
+  }
+  if (image->width % tile_width || image->height % tile_height) {
+    error_log("Error: Image size must be a multiple of the tile size.\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Chunky to planar conversion of a band of rows, in interleaved layout
+void c2p_rows(const Image *image, int y, int rows, unsigned char *bpl_data) {
+  int byte_width = image->width / 8;
+  int i = y * image->width;
+
+  for (int row = 0; row < rows; row++) {
+    unsigned char *row_start = bpl_data + row * byte_width * image->bitplanes;
 
     for (int x = 0; x < byte_width; x++) {
       unsigned char plane_bytes[8] = {0};
@@ -202,8 +285,53 @@ void c2p(const Image *image, unsigned char *bpl_data, int interleaved) {
       }
 
       for (int bpl = 0; bpl < image->bitplanes; bpl++) {
-        bpl_data[row_start + x + bpl_offset * bpl] = plane_bytes[bpl];
+        row_start[x + byte_width * bpl] = plane_bytes[bpl];
+      }
+    }
+  }
+}
+
+// Chunky to planar conversion of a band of rows for a single plane
+void c2p_plane_rows(const Image *image, int plane, int y, int rows,
+                    unsigned char *bpl_data) {
+  int byte_width = image->width / 8;
+  int i = y * image->width;
+  unsigned char mask = 1 << plane;
+
+  for (int x = 0; x < byte_width * rows; x++) {
+    unsigned char plane_byte = 0;
+    for (int p = 0; p < 8; p++) {
+      if (image->palette_order[image->data[i++]] & mask) {
+        plane_byte |= (1 << (7 - p));
       }
     }
+    bpl_data[x] = plane_byte;
+  }
+}
+
+// Chunky to planar conversion
+void c2p(const Image *image, unsigned char *bpl_data, int interleaved) {
+  if (interleaved) {
+    c2p_rows(image, 0, image->height, bpl_data);
+    return;
+  }
+  int plane_size = (image->width / 8) * image->height;
+  for (int p = 0; p < image->bitplanes; p++) {
+    c2p_plane_rows(image, p, 0, image->height, bpl_data + p * plane_size);
+  }
+}
+
+// Chunky to planar conversion of each tile in turn, with tiles in row order
+// and each tile's bitplane data contiguous
+void c2p_tiles(const Image *image, int tile_width, int tile_height,
+               unsigned char *bpl_data, int interleaved) {
+  int tile_size = (tile_width / 8) * tile_height * image->bitplanes;
+  for (int y = 0; y < image->height; y += tile_height) {
+    for (int x = 0; x < image->width; x += tile_width) {
+      Image tile = crop_image(image, x, y, tile_width, tile_height);
+      c2p(&tile, bpl_data, interleaved);
+      free(tile.data);
+      bpl_data += tile_size;
+    }
   }
 }
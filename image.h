@@ -1,3 +1,6 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
 #include <png.h>
 
 typedef struct {
@@ -17,4 +20,23 @@ Image read_png_indexed(char *input_file);
 
 void write_png_indexed(const char *filename, const Image *image);
 
+void color_histogram(const Image *image, int *counts);
+
+int compact_palette(Image *image, int remove_unused, int merge_duplicates,
+                    int *remap);
+
+Image crop_image(const Image *image, int x, int y, int width, int height);
+
+int check_tile_size(const Image *image, int tile_width, int tile_height);
+
 void c2p(const Image *image, unsigned char *bpl_data, int interleaved);
+
+void c2p_tiles(const Image *image, int tile_width, int tile_height,
+               unsigned char *bpl_data, int interleaved);
+
+void c2p_rows(const Image *image, int y, int rows, unsigned char *bpl_data);
+
+void c2p_plane_rows(const Image *image, int plane, int y, int rows,
+                    unsigned char *bpl_data);
+
+#endif // IMAGE_H
@@ -0,0 +1,88 @@
+// Packed output, using the same zlib compression bplopt optimises for
+//
+// Data is split into chunks which are packed independently, so they can be
+// unpacked as they stream in. All values are big-endian:
+//
+//   "BPLZ"
+//   u32 unpacked size
+//   u32 number of chunks
+//   per chunk:
+//     u32 unpacked size
+//     u32 packed size
+//     zlib stream
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#include "byte_order.h"
+#include "log.h"
+#include "pack.h"
+#include "parallel.h"
+#include "safe_mem.h"
+
+typedef struct {
+  const unsigned char *data;
+  uLong size;
+  unsigned char *packed;
+  uLongf packed_size;
+} Chunk;
+
+// Pack a single chunk
+static void pack_chunk(int index, void *arg) {
+  Chunk *chunk = &((Chunk *)arg)[index];
+  chunk->packed_size = compressBound(chunk->size);
+  chunk->packed = safe_malloc(chunk->packed_size);
+  compress(chunk->packed, &chunk->packed_size, chunk->data, chunk->size);
+}
+
+static void write_u32(FILE *fp, uint32_t val) {
+  unsigned char buf[4];
+  put_u32(buf, val);
+  fwrite(buf, 1, 4, fp);
+}
+
+// Pack data in chunks of up to `chunk_size` bytes (0 for a single chunk),
+// using up to `jobs` threads
+int write_packed(const char *filename, const unsigned char *data, size_t size,
+                 size_t chunk_size, int jobs) {
+  if (!chunk_size || chunk_size > size)
+    chunk_size = size;
+  int num_chunks = chunk_size ? (size + chunk_size - 1) / chunk_size : 0;
+  Chunk *chunks = safe_calloc(num_chunks, sizeof(Chunk));
+  for (int c = 0; c < num_chunks; c++) {
+    size_t offset = c * chunk_size;
+    chunks[c].data = data + offset;
+    chunks[c].size = size - offset < chunk_size ? size - offset : chunk_size;
+  }
+
+  parallel_for(num_chunks, jobs, pack_chunk, chunks);
+
+  int success = 0;
+  size_t packed_total = 0;
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    error_log("Error: Could not open %s for writing.\n", filename);
+  } else {
+    fwrite("BPLZ", 1, 4, fp);
+    write_u32(fp, size);
+    write_u32(fp, num_chunks);
+    for (int c = 0; c < num_chunks; c++) {
+      write_u32(fp, chunks[c].size);
+      write_u32(fp, chunks[c].packed_size);
+      fwrite(chunks[c].packed, 1, chunks[c].packed_size, fp);
+      packed_total += chunks[c].packed_size;
+    }
+    fclose(fp);
+    success = 1;
+    verbose_log("Packed %s: %zu -> %zu bytes in %d chunks\n", filename, size,
+                packed_total, num_chunks);
+  }
+
+  for (int c = 0; c < num_chunks; c++) {
+    free(chunks[c].packed);
+  }
+  free(chunks);
+  return success;
+}
@@ -0,0 +1,4 @@
+#include <stddef.h>
+
+int write_packed(const char *filename, const unsigned char *data, size_t size,
+                 size_t chunk_size, int jobs);
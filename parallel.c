@@ -0,0 +1,59 @@
+// Helpers for running independent work items on multiple threads
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "parallel.h"
+#include "safe_mem.h"
+
+typedef struct {
+  int count;
+  int first;
+  int stride;
+  void (*fn)(int index, void *arg);
+  void *arg;
+} ParallelJob;
+
+int default_jobs(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (int)cpus : 1;
+}
+
+static void *run_job(void *arg) {
+  ParallelJob *job = arg;
+  for (int i = job->first; i < job->count; i += job->stride) {
+    job->fn(i, job->arg);
+  }
+  return NULL;
+}
+
+// Call `fn` for each index from 0 to `count` - 1, using up to `jobs` threads
+// including the calling thread. Each thread handles every `jobs`th index.
+void parallel_for(int count, int jobs, void (*fn)(int index, void *arg),
+                  void *arg) {
+  if (jobs > count)
+    jobs = count;
+  if (jobs < 1)
+    jobs = 1;
+  pthread_t *threads = safe_malloc(jobs * sizeof(pthread_t));
+  ParallelJob *parallel_jobs = safe_malloc(jobs * sizeof(ParallelJob));
+  for (int t = 0; t < jobs; t++) {
+    parallel_jobs[t] = (ParallelJob){count, t, jobs, fn, arg};
+  }
+  for (int t = 1; t < jobs; t++) {
+    if (pthread_create(&threads[t], NULL, run_job, &parallel_jobs[t])) {
+      error_log("Error: Failed to create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  run_job(&parallel_jobs[0]);
+  for (int t = 1; t < jobs; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  free(threads);
+  free(parallel_jobs);
+}
@@ -0,0 +1,4 @@
+int default_jobs(void);
+
+void parallel_for(int count, int jobs, void (*fn)(int index, void *arg),
+                  void *arg);
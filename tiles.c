@@ -0,0 +1,198 @@
+// Tile mode: an image is scored as the sum of independently compressed tiles.
+// Tiles are only recompressed when the order of a color they use changes, and
+// are compressed in parallel.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "safe_mem.h"
+#include "tiles.h"
+
+static int is_dirty(const Tile *tile) {
+  if (!tile->scored)
+    return 1;
+  for (int k = 0; k < tile->num_used; k++) {
+    if (tile->image.palette_order[tile->used[k]] != tile->scored_order[k])
+      return 1;
+  }
+  return 0;
+}
+
+// Compress with a reused stream, as setting up deflate state can cost more
+// than compressing a small tile
+static void score_tile(Tile *tile, int interleaved, z_stream *strm) {
+  c2p(&tile->image, tile->bpl_data, interleaved);
+  deflateReset(strm);
+  strm->next_in = tile->bpl_data;
+  strm->avail_in = tile->bpl_size;
+  strm->next_out = tile->compressed_data;
+  strm->avail_out = compressBound(tile->bpl_size);
+  deflate(strm, Z_FINISH);
+  tile->size = strm->total_out;
+  for (int k = 0; k < tile->num_used; k++) {
+    tile->scored_order[k] = tile->image.palette_order[tile->used[k]];
+  }
+  tile->scored = 1;
+}
+
+// Score dirty tiles until none are left
+static void score_dirty(TileSet *set, z_stream *strm) {
+  for (;;) {
+    pthread_mutex_lock(&set->lock);
+    int t = set->next < set->num_dirty ? set->dirty[set->next++] : -1;
+    pthread_mutex_unlock(&set->lock);
+    if (t < 0)
+      return;
+    score_tile(&set->tiles[t], set->interleaved, strm);
+  }
+}
+
+typedef struct {
+  TileSet *set;
+  int index;
+} TileThread;
+
+static void *tile_thread(void *arg) {
+  TileSet *set = ((TileThread *)arg)->set;
+  z_stream *strm = &set->streams[((TileThread *)arg)->index];
+  free(arg);
+  int generation = 0;
+  for (;;) {
+    pthread_mutex_lock(&set->lock);
+    while (!set->quit && set->generation == generation)
+      pthread_cond_wait(&set->start, &set->lock);
+    if (set->quit) {
+      pthread_mutex_unlock(&set->lock);
+      return NULL;
+    }
+    generation = set->generation;
+    pthread_mutex_unlock(&set->lock);
+
+    score_dirty(set, strm);
+
+    pthread_mutex_lock(&set->lock);
+    if (++set->finished == set->num_threads)
+      pthread_cond_signal(&set->done);
+    pthread_mutex_unlock(&set->lock);
+  }
+}
+
+// Split image into tiles, using `jobs` threads in total to score them
+void create_tiles(TileSet *set, const Image *image, int tile_width,
+                  int tile_height, int interleaved, int jobs) {
+  memset(set, 0, sizeof(*set));
+  set->tile_width = tile_width;
+  set->tile_height = tile_height;
+  set->interleaved = interleaved;
+  set->num_tiles = (image->width / tile_width) * (image->height / tile_height);
+  set->tiles = safe_calloc(set->num_tiles, sizeof(Tile));
+  set->dirty = safe_malloc(set->num_tiles * sizeof(int));
+
+  unsigned char *seen = safe_malloc(image->num_colors);
+  int t = 0;
+  for (int y = 0; y < image->height; y += tile_height) {
+    for (int x = 0; x < image->width; x += tile_width) {
+      Tile *tile = &set->tiles[t++];
+      tile->image = crop_image(image, x, y, tile_width, tile_height);
+
+      memset(seen, 0, image->num_colors);
+      for (int i = 0; i < tile_width * tile_height; i++) {
+        if (tile->image.data[i] < image->num_colors)
+          seen[tile->image.data[i]] = 1;
+      }
+      tile->used = safe_malloc(image->num_colors);
+      for (int c = 0; c < image->num_colors; c++) {
+        if (seen[c])
+          tile->used[tile->num_used++] = c;
+      }
+      tile->scored_order = safe_malloc(image->num_colors);
+
+      tile->bpl_size = (tile_width / 8) * tile_height * image->bitplanes;
+      tile->bpl_data = safe_malloc(tile->bpl_size);
+      tile->compressed_data = safe_malloc(compressBound(tile->bpl_size));
+    }
+  }
+  free(seen);
+
+  // The calling thread also scores tiles
+  pthread_mutex_init(&set->lock, NULL);
+  pthread_cond_init(&set->start, NULL);
+  pthread_cond_init(&set->done, NULL);
+  int num_threads = jobs > 1 ? jobs - 1 : 0;
+  set->threads = safe_malloc(num_threads * sizeof(pthread_t));
+  set->streams = safe_calloc(num_threads + 1, sizeof(z_stream));
+  for (int i = 0; i <= num_threads; i++) {
+    deflateInit(&set->streams[i], Z_DEFAULT_COMPRESSION);
+  }
+  for (int i = 0; i < num_threads; i++) {
+    TileThread *thread = safe_malloc(sizeof(TileThread));
+    *thread = (TileThread){set, i};
+    if (pthread_create(&set->threads[i], NULL, tile_thread, thread)) {
+      free(thread);
+      break;
+    }
+    set->num_threads++;
+  }
+}
+
+// Total compressed size of all tiles for the current palette order
+uLongf compress_tiles(TileSet *set) {
+  set->num_dirty = 0;
+  for (int t = 0; t < set->num_tiles; t++) {
+    if (is_dirty(&set->tiles[t]))
+      set->dirty[set->num_dirty++] = t;
+  }
+  set->next = 0;
+
+  if (set->num_threads && set->num_dirty > 1) {
+    pthread_mutex_lock(&set->lock);
+    set->finished = 0;
+    set->generation++;
+    pthread_cond_broadcast(&set->start);
+    pthread_mutex_unlock(&set->lock);
+
+    score_dirty(set, &set->streams[set->num_threads]);
+
+    pthread_mutex_lock(&set->lock);
+    while (set->finished < set->num_threads)
+      pthread_cond_wait(&set->done, &set->lock);
+    pthread_mutex_unlock(&set->lock);
+  } else {
+    score_dirty(set, &set->streams[set->num_threads]);
+  }
+
+  uLongf total = 0;
+  for (int t = 0; t < set->num_tiles; t++) {
+    total += set->tiles[t].size;
+  }
+  return total;
+}
+
+void free_tiles(TileSet *set) {
+  pthread_mutex_lock(&set->lock);
+  set->quit = 1;
+  pthread_cond_broadcast(&set->start);
+  pthread_mutex_unlock(&set->lock);
+  for (int i = 0; i < set->num_threads; i++) {
+    pthread_join(set->threads[i], NULL);
+  }
+  pthread_mutex_destroy(&set->lock);
+  pthread_cond_destroy(&set->start);
+  pthread_cond_destroy(&set->done);
+  free(set->threads);
+  for (int i = 0; i <= set->num_threads; i++) {
+    deflateEnd(&set->streams[i]);
+  }
+  free(set->streams);
+
+  for (int t = 0; t < set->num_tiles; t++) {
+    Tile *tile = &set->tiles[t];
+    free(tile->image.data);
+    free(tile->used);
+    free(tile->scored_order);
+    free(tile->bpl_data);
+    free(tile->compressed_data);
+  }
+  free(set->tiles);
+  free(set->dirty);
+}
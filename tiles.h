@@ -0,0 +1,43 @@
+#include <pthread.h>
+#include <zlib.h>
+
+#include "image.h"
+
+typedef struct {
+  Image image; // Shares palette order with the source image
+  int num_used;
+  unsigned char *used;         // Colors used in tile
+  unsigned char *scored_order; // Order of used colors when last scored
+  int scored;
+  uLongf size;
+  int bpl_size;
+  unsigned char *bpl_data;
+  unsigned char *compressed_data;
+} Tile;
+
+typedef struct {
+  int tile_width;
+  int tile_height;
+  int interleaved;
+  int num_tiles;
+  Tile *tiles;
+
+  // Thread pool for scoring tiles
+  int num_threads;
+  pthread_t *threads;
+  z_stream *streams; // One per thread, with the calling thread's last
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  int generation;
+  int finished;
+  int quit;
+  int *dirty;
+  int num_dirty;
+  int next;
+} TileSet;
+
+void create_tiles(TileSet *set, const Image *image, int tile_width,
+                  int tile_height, int interleaved, int jobs);
+uLongf compress_tiles(TileSet *set);
+void free_tiles(TileSet *set);